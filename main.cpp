@@ -9,6 +9,25 @@
 #include <random>
 #include <string>
 #include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+
+//  Offscreen render backend, compile with -DSATURN_HEADLESS and link -lEGL
+//  Note: Renders into a framebuffer object on a surfaceless EGL context (e.g. Mesa llvmpipe) so no display or GPU is required
+#ifdef SATURN_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 //  Macro for generating x & y offsets
 #define _GEN_RAND_PAIR(_A, _B) {_A = ((0 + (rand() % 16)) - 8); _B = (0 + (rand() % 16)) - 8;};
@@ -29,6 +48,17 @@ const int8_t   health_bonus_frequency  = 100;
 const int8_t   max_health              = 100;
 const int8_t   max_ammo                = 30;
 
+//  Indices into the voice pools
+const uint8_t   sample_crash            = 0;
+const uint8_t   sample_music            = 1;
+const uint8_t   sample_missile_travel   = 2;
+const uint8_t   sample_missile_impact   = 3;
+const uint8_t   audio_command_play      = 0;
+const uint8_t   audio_command_impact    = 1;
+const uint8_t   audio_command_stop_all  = 2;
+const uint8_t   audio_no_owner          = 0xFF;
+const uint32_t  audio_queue_size        = 256;
+
 int8_t      frame_count             = 0;
 uint16_t    keycode_last_tick       = 0;
 _Float32    menu_rotation           = 0.0;
@@ -58,7 +88,7 @@ struct PowerUp
 struct Missile
 {
     _Float32 y_spawn_offset, z_spawn_offset;
-    bool is_travelling, has_colided;
+    bool is_travelling, has_colided, explosion_lit;
     Lazarus::MeshManager::Mesh mesh;
     Lazarus::LightManager::Light explosion;
 };
@@ -96,13 +126,565 @@ uint32_t health_text_index  = 0;
 uint32_t ammo_text_index    = 0;
 uint32_t points_text_index  = 0;
 
-std::vector<Lazarus::AudioManager::Audio> samples = {};
 std::vector<Missile> missiles = {};
 std::vector<Asteroid> asteroids = {};
 Spaceship spaceship = {};
 PowerUp health_bonus = {};
 PowerUp ammo_bonus = {};
 
+struct SampleDefinition
+{
+    const char *path;
+    bool loop;
+    uint8_t voices;
+    //  How long a one-shot plays for, looping samples hold their voice until stopped
+    uint32_t duration_ms;
+};
+
+struct Voice
+{
+    Lazarus::AudioManager::Audio audio;
+    uint8_t priority, owner;
+    bool active;
+    std::chrono::steady_clock::time_point started;
+};
+
+struct AudioCommand
+{
+    uint8_t type, sample, priority, owner;
+};
+
+//  Single producer (game thread), single consumer (audio thread) ring buffer
+struct AudioQueue
+{
+    AudioCommand commands[audio_queue_size];
+    std::atomic<uint32_t> head, tail;
+};
+
+struct QualityLevel
+{
+    const char *name;
+    uint8_t explosion_lights, fragment_cap;
+    _Float32 asteroid_draw_distance;
+    bool draw_planet, draw_skybox;
+};
+
+struct QualityGovernor
+{
+    bool enabled, requested, pinned;
+    uint8_t level;
+    uint32_t frame, cooldown, sample_count;
+    _Float32 target_ms, average_ms;
+    _Float32 samples[60];
+    //  Points at std::cout unless --quality-log opens log_file
+    std::ostream *log;
+    std::ofstream log_file;
+};
+
+struct SessionFrame
+{
+    uint16_t key_code;
+    //  Relative to the display center, which is what move_spaceship() steers against
+    int32_t mouse_offset_x, mouse_offset_y;
+};
+
+struct Session
+{
+    std::string replay_path, record_path;
+    std::vector<SessionFrame> frames;
+    std::ofstream recording;
+};
+
+struct Headless
+{
+    bool enabled;
+    uint32_t frames, width, height;
+    std::string golden_dir, stats_path;
+    std::vector<uint32_t> golden_frames;
+};
+
+struct FrameStats
+{
+    _Float64 cpu_submit_ms, gpu_ms;
+    uint32_t draw_calls;
+    uint64_t triangles;
+    uint8_t quality;
+};
+
+const SampleDefinition sample_definitions[] = {
+    //  path                                loop    voices  duration
+    {"assets/sound/crash1.mp3",             false,  4,      1900},
+    {"assets/sound/headswirler.wav",        true,   1,      0},
+    {"assets/sound/missile_travel.mp3",     true,   4,      0},
+    {"assets/sound/missile_impact.mp3",     true,   4,      0}
+};
+
+//  Fragment cap that leaves fracturing as it is without a governor
+const uint8_t fragments_uncapped = UINT8_MAX;
+
+//  Ordered cheapest to most expensive, the governor steps one level at a time
+//  Note: Asteroids only have the one mesh, so their LOD is a draw distance (camera sits at x = 0)
+const QualityLevel quality_levels[] = {
+    //  name        lights  fragments   draw dist   planet  skybox
+    {"minimal",     1,      0,          30.0,       false,  false},
+    {"low",         4,      12,         40.0,       false,  true},
+    {"medium",      10,     30,         50.0,       true,   true},
+    {"high",        max_ammo, fragments_uncapped, 1000.0, true,  true}
+};
+const uint8_t   quality_level_count     = sizeof(quality_levels) / sizeof(QualityLevel);
+//  Hysteresis band around the target, and how long to let the average settle after a change
+const _Float32  quality_downgrade_ratio = 1.10;
+const _Float32  quality_upgrade_ratio   = 0.80;
+const uint32_t  quality_cooldown_frames = 120;
+
+Session session = {};
+QualityGovernor governor = {true, false, false, quality_level_count - 1, 0, 0, 0, 16.6, 0.0, {}, &std::cout};
+Headless headless = {false, 600, 1280, 720, "golden", "", {}};
+//  The null backend runs the queue and voice pools without touching an audio device, i.e. when headless
+bool null_audio = false;
+AudioQueue audio_queue = {};
+std::vector<std::vector<Voice>> voices = {};
+std::thread audio_thread;
+std::atomic<bool> audio_running(false);
+uint32_t audio_dropped = 0;
+uint32_t draw_call_count = 0;
+
+void load_voices()
+{
+    for(uint32_t i = 0; i < sizeof(sample_definitions) / sizeof(SampleDefinition); i++)
+    {
+        std::vector<Voice> pool = {};
+
+        //  Each voice is its own copy of the sample so that they can overlap
+        for(uint32_t j = 0; j < sample_definitions[i].voices; j++)
+        {
+            Voice voice = {};
+            voice.active = false;
+            voice.priority = 0;
+            voice.owner = audio_no_owner;
+
+            if(!null_audio)
+            {
+                voice.audio = sample_definitions[i].loop
+                ? audio_manager->createAudio(sample_definitions[i].path, false, -1)
+                : audio_manager->createAudio(sample_definitions[i].path);
+                audio_manager->loadAudio(voice.audio);
+                audio_manager->pauseAudio(voice.audio);
+            };
+
+            pool.push_back(voice);
+        };
+
+        voices.push_back(pool);
+    };
+};
+
+void queue_audio(uint8_t type, uint8_t sample, uint8_t priority = 0, uint8_t owner = audio_no_owner)
+{
+    //  This is all the game thread pays for a sound
+    //  Note: If the audio thread has fallen a full queue behind, a play is dropped (and counted). Impacts and stops
+    //  end looping voices that nothing else would stop, so those wait for the audio thread to make room instead.
+    bool must_deliver = type != audio_command_play;
+    uint32_t head = audio_queue.head.load(std::memory_order_relaxed);
+    uint32_t next = (head + 1) % audio_queue_size;
+
+    while(next == audio_queue.tail.load(std::memory_order_acquire))
+    {
+        if(!must_deliver || !audio_running.load(std::memory_order_acquire))
+        {
+            audio_dropped += 1;
+            return;
+        };
+
+        std::this_thread::yield();
+    };
+
+    audio_queue.commands[head] = {type, sample, priority, owner};
+    audio_queue.head.store(next, std::memory_order_release);
+};
+
+void play_voice(const AudioCommand &command)
+{
+    std::vector<Voice> &pool = voices[command.sample];
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    Voice *chosen = nullptr;
+
+    for(uint32_t i = 0; i < pool.size(); i++)
+    {
+        //  Lazarus doesn't report when a one-shot ends, so go by its length
+        bool finished = !sample_definitions[command.sample].loop &&
+        (now - pool[i].started) >= std::chrono::milliseconds(sample_definitions[command.sample].duration_ms);
+
+        if(!pool[i].active || finished)
+        {
+            chosen = &pool[i];
+            break;
+        };
+
+        //  Otherwise steal the lowest priority voice, oldest first, so long as it doesn't outrank this one
+        if(pool[i].priority > command.priority) continue;
+        if(
+            chosen == nullptr                           ||
+            pool[i].priority < chosen->priority         ||
+            (pool[i].priority == chosen->priority && pool[i].started < chosen->started)
+        )
+        {
+            chosen = &pool[i];
+        };
+    };
+
+    if(chosen == nullptr) return;
+
+    chosen->active      = true;
+    chosen->priority    = command.priority;
+    chosen->owner       = command.owner;
+    chosen->started     = now;
+
+    if(!null_audio)
+    {
+        audio_manager->setPlaybackCursor(chosen->audio, 1);
+        audio_manager->playAudio(chosen->audio);
+    };
+};
+
+void stop_voices(uint8_t sample, uint8_t owner)
+{
+    //  Stops every voice of the sample, or only those belonging to the given owner
+    std::vector<Voice> &pool = voices[sample];
+
+    for(uint32_t i = 0; i < pool.size(); i++)
+    {
+        if(!pool[i].active || (owner != audio_no_owner && owner != pool[i].owner)) continue;
+
+        pool[i].active = false;
+        if(!null_audio) audio_manager->pauseAudio(pool[i].audio);
+    };
+};
+
+void stop_owner_voices(uint8_t owner)
+{
+    //  Stops whatever the owner has playing, across every sample
+    for(uint8_t i = 0; i < voices.size(); i++) stop_voices(i, owner);
+};
+
+void drain_audio_queue()
+{
+    uint32_t tail = audio_queue.tail.load(std::memory_order_relaxed);
+
+    while(tail != audio_queue.head.load(std::memory_order_acquire))
+    {
+        const AudioCommand &command = audio_queue.commands[tail];
+
+        switch (command.type)
+        {
+        case audio_command_play:
+            play_voice(command);
+            break;
+
+        //  A missile hitting something swaps its travel sound for the impact
+        case audio_command_impact:
+            stop_voices(sample_missile_travel, command.owner);
+            play_voice(command);
+            break;
+
+        case audio_command_stop_all:
+            stop_owner_voices(command.owner);
+            break;
+
+        default:
+            break;
+        }
+
+        tail = (tail + 1) % audio_queue_size;
+        audio_queue.tail.store(tail, std::memory_order_release);
+    };
+};
+
+void start_audio()
+{
+    //  From here on only the audio thread touches audio_manager
+    audio_running = true;
+    audio_thread = std::thread([]()
+    {
+        while(audio_running.load(std::memory_order_acquire))
+        {
+            drain_audio_queue();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        };
+
+        //  Silence everything on the way out
+        drain_audio_queue();
+        for(uint8_t i = 0; i < voices.size(); i++) stop_voices(i, audio_no_owner);
+    });
+};
+
+void stop_audio()
+{
+    audio_running = false;
+    if(audio_thread.joinable()) audio_thread.join();
+
+    if(audio_dropped > 0) std::fprintf(stderr, "Audio: %u events dropped on a full queue\n", audio_dropped);
+};
+
+//  GPU timer and primitive queries, shared by the windowed and headless loops
+//  Note: Results are read back this many frames late, so as not to stall the pipeline
+const uint32_t query_latency = 4;
+
+GLuint timer_queries[query_latency]        = {};
+GLuint primitive_queries[query_latency]    = {};
+
+void create_frame_queries()
+{
+    glGenQueries(query_latency, timer_queries);
+    glGenQueries(query_latency, primitive_queries);
+};
+
+void delete_frame_queries()
+{
+    glDeleteQueries(query_latency, timer_queries);
+    glDeleteQueries(query_latency, primitive_queries);
+};
+
+void begin_frame_queries(uint32_t frame)
+{
+    glBeginQuery(GL_TIME_ELAPSED, timer_queries[frame % query_latency]);
+    glBeginQuery(GL_PRIMITIVES_GENERATED, primitive_queries[frame % query_latency]);
+};
+
+void end_frame_queries()
+{
+    glEndQuery(GL_PRIMITIVES_GENERATED);
+    glEndQuery(GL_TIME_ELAPSED);
+};
+
+void read_frame_queries(uint32_t frame, _Float64 &gpu_ms, uint64_t &triangles)
+{
+    GLuint64 gpu_ns = 0;
+    GLuint64 primitives = 0;
+    glGetQueryObjectui64v(timer_queries[frame % query_latency], GL_QUERY_RESULT, &gpu_ns);
+    glGetQueryObjectui64v(primitive_queries[frame % query_latency], GL_QUERY_RESULT, &primitives);
+
+    gpu_ms      = static_cast<_Float64>(gpu_ns) / 1000000.0;
+    triangles   = primitives;
+};
+
+#ifdef SATURN_HEADLESS
+EGLDisplay  egl_display         = EGL_NO_DISPLAY;
+EGLContext  egl_context         = EGL_NO_CONTEXT;
+GLuint      offscreen_fbo       = 0;
+GLuint      offscreen_color     = 0;
+GLuint      offscreen_depth     = 0;
+
+void headless_create_context()
+{
+    //  Prefer Mesa's surfaceless platform, which needs neither an X server nor a GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    egl_display = get_platform_display != nullptr
+    ? get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+    : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major = 0;
+    EGLint minor = 0;
+    if(egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor))
+    {
+        std::fprintf(stderr, "Headless: failed to initialise EGL display\n");
+        std::exit(1);
+    };
+
+    const EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE,       EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE,    EGL_OPENGL_BIT,
+        EGL_RED_SIZE,           8,
+        EGL_GREEN_SIZE,         8,
+        EGL_BLUE_SIZE,          8,
+        EGL_ALPHA_SIZE,         8,
+        EGL_DEPTH_SIZE,         24,
+        EGL_NONE
+    };
+    const EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION,          3,
+        EGL_CONTEXT_MINOR_VERSION,          3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config = nullptr;
+    EGLint config_count = 0;
+    eglBindAPI(EGL_OPENGL_API);
+    eglChooseConfig(egl_display, config_attributes, &config, 1, &config_count);
+    egl_context = eglCreateContext(egl_display, config_count > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attributes);
+
+    if(egl_context == EGL_NO_CONTEXT || !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context))
+    {
+        std::fprintf(stderr, "Headless: failed to create EGL context (0x%x)\n", eglGetError());
+        std::exit(1);
+    };
+
+    //  Note: GLEW builds targeting GLX report a missing display under EGL, the entry points are still resolved
+    glewExperimental = GL_TRUE;
+    GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if(glew_status == GLEW_ERROR_NO_GLX_DISPLAY) glew_status = GLEW_OK;
+#endif
+    if(glew_status != GLEW_OK)
+    {
+        std::fprintf(stderr, "Headless: failed to load OpenGL entry points\n");
+        std::exit(1);
+    };
+
+    //  There is no default framebuffer without a surface, render into our own
+    glGenRenderbuffers(1, &offscreen_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreen_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, headless.width, headless.height);
+    glGenRenderbuffers(1, &offscreen_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, offscreen_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, headless.width, headless.height);
+
+    glGenFramebuffers(1, &offscreen_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, offscreen_depth);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::fprintf(stderr, "Headless: offscreen framebuffer is incomplete\n");
+        std::exit(1);
+    };
+};
+
+void headless_load_config(int8_t shader)
+{
+    //  Mirrors the render state the window would set up in loadConfig()
+    glUseProgram(shader);
+    glViewport(0, 0, headless.width, headless.height);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+};
+
+void headless_destroy_context()
+{
+    glDeleteFramebuffers(1, &offscreen_fbo);
+    glDeleteRenderbuffers(1, &offscreen_color);
+    glDeleteRenderbuffers(1, &offscreen_depth);
+
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(egl_display, egl_context);
+    eglTerminate(egl_display);
+};
+
+uint32_t png_crc(const uint8_t *data, size_t length, uint32_t crc)
+{
+    static uint32_t table[256] = {};
+    static bool table_ready = false;
+
+    if(!table_ready)
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for(uint32_t k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        };
+        table_ready = true;
+    };
+
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+};
+
+void png_chunk(std::ofstream &file, const char *type, const std::vector<uint8_t> &data)
+{
+    uint8_t header[8] = {
+        static_cast<uint8_t>(data.size() >> 24), static_cast<uint8_t>(data.size() >> 16),
+        static_cast<uint8_t>(data.size() >> 8),  static_cast<uint8_t>(data.size()),
+        static_cast<uint8_t>(type[0]), static_cast<uint8_t>(type[1]),
+        static_cast<uint8_t>(type[2]), static_cast<uint8_t>(type[3])
+    };
+    uint32_t crc = png_crc(header + 4, 4, 0);
+    crc = png_crc(data.data(), data.size(), crc);
+    uint8_t footer[4] = {
+        static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16),
+        static_cast<uint8_t>(crc >> 8),  static_cast<uint8_t>(crc)
+    };
+
+    file.write(reinterpret_cast<const char *>(header), 8);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    file.write(reinterpret_cast<const char *>(footer), 4);
+};
+
+void write_png(const std::string &path, uint32_t width, uint32_t height, const std::vector<uint8_t> &rgba)
+{
+    //  Golden frames only need to be exact, not small. Scanlines go out as stored (uncompressed) deflate blocks.
+    //  Note: GL reads bottom-up, PNG is top-down
+    std::vector<uint8_t> raw = {};
+    uint32_t stride = width * 4;
+    for(uint32_t y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        const uint8_t *row = rgba.data() + ((height - 1 - y) * stride);
+        raw.insert(raw.end(), row, row + stride);
+    };
+
+    std::vector<uint8_t> idat = {0x78, 0x01};
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+    for(size_t offset = 0; offset < raw.size(); offset += 65535)
+    {
+        uint16_t length = static_cast<uint16_t>(std::min<size_t>(65535, raw.size() - offset));
+        bool final_block = (offset + length) >= raw.size();
+        idat.push_back(final_block ? 1 : 0);
+        idat.push_back(length & 0xFF);
+        idat.push_back(length >> 8);
+        idat.push_back(~length & 0xFF);
+        idat.push_back((~length >> 8) & 0xFF);
+        idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + length);
+
+        for(size_t i = offset; i < offset + length; i++)
+        {
+            adler_a = (adler_a + raw[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        };
+
+        if(final_block) break;
+    };
+    uint32_t adler = (adler_b << 16) | adler_a;
+    idat.push_back(adler >> 24);
+    idat.push_back(adler >> 16);
+    idat.push_back(adler >> 8);
+    idat.push_back(adler);
+
+    std::vector<uint8_t> ihdr = {
+        static_cast<uint8_t>(width >> 24),  static_cast<uint8_t>(width >> 16),  static_cast<uint8_t>(width >> 8),  static_cast<uint8_t>(width),
+        static_cast<uint8_t>(height >> 24), static_cast<uint8_t>(height >> 16), static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+        8, 6, 0, 0, 0
+    };
+
+    std::ofstream file(path, std::ios::binary);
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char *>(signature), 8);
+    png_chunk(file, "IHDR", ihdr);
+    png_chunk(file, "IDAT", idat);
+    png_chunk(file, "IEND", {});
+};
+
+void capture_golden(uint32_t frame)
+{
+    std::vector<uint8_t> pixels(headless.width * headless.height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, offscreen_fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, headless.width, headless.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    char name[32] = {};
+    std::snprintf(name, sizeof(name), "frame_%05u.png", frame);
+    std::filesystem::create_directories(headless.golden_dir);
+    write_png((std::filesystem::path(headless.golden_dir) / name).string(), headless.width, headless.height, pixels);
+};
+#endif
+
 void init()
 {   
     //  Engine settings
@@ -111,16 +693,33 @@ void init()
     globals.setLaunchInFullscreen(true);
     globals.setCursorHidden(true);
 
-    //  Construct window
-    //  TODO: Fix the need to be init window prior to shader
-    window = std::make_unique<Lazarus::WindowManager>("Saturns Rage");
+#ifdef SATURN_HEADLESS
+    if(headless.enabled)
+    {
+        //  No window, input or audio device is available headless
+        //  Note: The context must still be current prior to shader init
+        globals.setDisplaySize(headless.width, headless.height);
+        headless_create_context();
+        null_audio = true;
+        shader = shader_program.initialiseShader();
+        headless_load_config(shader);
+    }
+    else
+#endif
+    {
+        //  Construct window
+        //  TODO: Fix the need to be init window prior to shader
+        window = std::make_unique<Lazarus::WindowManager>("Saturns Rage");
+
+        //  Initialise resources
+        window->initialise();
+        event_manager.initialise();
+        if(!null_audio) audio_manager->initialise();
+        shader = shader_program.initialiseShader();
+        window->loadConfig(shader);
+    };
 
-    //  Initialise resources
-    window->initialise();
-    event_manager.initialise();
-    audio_manager->initialise();
-    shader = shader_program.initialiseShader();
-    window->loadConfig(shader);
+    create_frame_queries();
 
     //  Construct managers
     text_manager     = std::make_unique<Lazarus::TextManager>(shader);
@@ -196,6 +795,7 @@ void init()
         Missile missile         = {};
         missile.is_travelling   = false;
         missile.has_colided     = false;
+        missile.explosion_lit   = false;
         missile.y_spawn_offset  = 0.0;
         missile.z_spawn_offset  = 0.0;
         //  Note: Lightsources need to be unique, as they are loaded into a sized uniform array on the GPU and accessed by index (creation id)
@@ -229,23 +829,32 @@ void init()
     points_text_index   = text_manager->loadText(std::string("SCORE: ").append(std::to_string(player_points)), 0, (globals.getDisplayHeight() - 50), 10, 1.0f, 1.0f, 1.0f);
 
     //  Load audio
-    samples.push_back(audio_manager->createAudio("assets/sound/crash1.mp3"));
-    samples.push_back(audio_manager->createAudio("assets/sound/headswirler.wav", false, -1));
-    samples.push_back(audio_manager->createAudio("assets/sound/missile_travel.mp3", false, -1));
-    samples.push_back(audio_manager->createAudio("assets/sound/missile_impact.mp3", false, -1));
-    for(uint32_t i = 0; i < samples.size(); i++)
-    {
-        audio_manager->loadAudio(samples[i]);
-        audio_manager->pauseAudio(samples[i]);
-    };
+    load_voices();
+};
+
+void draw_mesh(Lazarus::MeshManager::Mesh &mesh)
+{
+    mesh_manager->loadMesh(mesh);
+    mesh_manager->drawMesh(mesh);
+
+    draw_call_count += 1;
+};
+
+void draw_text(uint32_t text_index)
+{
+    text_manager->drawText(text_index);
+
+    draw_call_count += 1;
 };
 
 void fracture_asteroid(Asteroid parent)
 {
     int target_size = asteroids.size() + 3;
+    uint8_t fragment_cap = quality_levels[governor.level].fragment_cap;
+    bool under_cap = fragment_cap == fragments_uncapped || (std::count_if(asteroids.begin(), asteroids.end(), [](const Asteroid &asteroid) { return asteroid.is_fragment; }) + 3) <= fragment_cap;
 
-    //  Dont repeat if fragments are getting too small
-    if(!((parent.scale / 2.0) < 0.5))
+    //  Dont repeat if fragments are getting too small, or there are already too many alive for the current quality level
+    if(!((parent.scale / 2.0) < 0.5) && under_cap)
     {
         while(asteroids.size() < target_size)
         {
@@ -285,32 +894,54 @@ void load_environment()
     camera_manager->loadCamera(camera);
     light_manager->loadLightSource(point_light);
 
+    //  Only the first few glowing explosions (up to the quality level's budget) are lit
+    //  Note: shader.frag skips dark lights, so each one over budget saves its per-fragment shading
+    //  Light uniforms persist on the GPU, so a dark light only needs uploading on the frame it goes out
+    uint8_t lit_explosions = 0;
     for(uint32_t i = 0; i < missiles.size(); i++)
     {
-        light_manager->loadLightSource(missiles[i].explosion);
+        bool lit = missiles[i].explosion.brightness > 0.0 && lit_explosions < quality_levels[governor.level].explosion_lights;
+
+        if(lit)
+        {
+            lit_explosions += 1;
+            light_manager->loadLightSource(missiles[i].explosion);
+        }
+        else if(missiles[i].explosion_lit)
+        {
+            Lazarus::LightManager::Light dark = missiles[i].explosion;
+            dark.brightness = 0.0;
+            light_manager->loadLightSource(dark);
+        };
+
+        missiles[i].explosion_lit = lit;
     };
 
-    world->drawSkyBox(skybox, camera);
+    if(quality_levels[governor.level].draw_skybox)
+    {
+        world->drawSkyBox(skybox, camera);
+        draw_call_count += 1;
+    };
 };
 
 void draw_assets()
 {
-    mesh_manager->loadMesh(saturn_planet);
-    mesh_manager->drawMesh(saturn_planet);
-    mesh_manager->loadMesh(saturn_ring);
-    mesh_manager->drawMesh(saturn_ring);
+    if(quality_levels[governor.level].draw_planet)
+    {
+        draw_mesh(saturn_planet);
+        draw_mesh(saturn_ring);
+    };
 
     //  Draw spaceship
-    mesh_manager->loadMesh(spaceship.mesh);
-    mesh_manager->drawMesh(spaceship.mesh);
+    draw_mesh(spaceship.mesh);
 
     //  Draw each asteroid
+    //  Note: Those further out than the quality level's draw distance are skipped
     for(uint32_t i = 0; i < asteroids.size(); i++)
     {
-        if(!asteroids[i].exploded)
+        if(!asteroids[i].exploded && asteroids[i].mesh.locationX > -quality_levels[governor.level].asteroid_draw_distance)
         {
-            mesh_manager->loadMesh(asteroids[i].mesh);
-            mesh_manager->drawMesh(asteroids[i].mesh);
+            draw_mesh(asteroids[i].mesh);
         }
     };
 
@@ -318,15 +949,13 @@ void draw_assets()
     //  Note: Only if it hasn't already been picked up
     if(!health_bonus.has_colided)
     {
-        mesh_manager->loadMesh(health_bonus.mesh);
-        mesh_manager->drawMesh(health_bonus.mesh);
+        draw_mesh(health_bonus.mesh);
     };
 
     //  Draw ammo powerup
     if(!ammo_bonus.has_colided)
     {
-        mesh_manager->loadMesh(ammo_bonus.mesh);
-        mesh_manager->drawMesh(ammo_bonus.mesh);
+        draw_mesh(ammo_bonus.mesh);
     };
 
     //  Draw missiles
@@ -334,19 +963,18 @@ void draw_assets()
     {
         if(missiles[i].is_travelling && !missiles[i].has_colided)
         {
-            mesh_manager->loadMesh(missiles[i].mesh);
-            mesh_manager->drawMesh(missiles[i].mesh);
+            draw_mesh(missiles[i].mesh);
         };
     };
 
     //  Draw HUD
     //  Note: Text is drawn last to overlay
     text_manager->loadText(std::string("SHIP HEALTH: ").append(std::to_string(spaceship.health)), 0, 0, 10, 1.0f, 0.0f, 0.0f, health_text_index);
-    text_manager->drawText(health_text_index);
+    draw_text(health_text_index);
     text_manager->loadText(std::string("AMMO: ").append(std::to_string(spaceship.ammo)), (globals.getDisplayWidth() - 330), 0, 10, 0.9f, 0.5f, 0.0f, ammo_text_index);
-    text_manager->drawText(ammo_text_index);
+    draw_text(ammo_text_index);
     text_manager->loadText(std::string("SCORE: ").append(std::to_string(player_points)), 0, (globals.getDisplayHeight() - 50), 10, 1.0f, 1.0f, 1.0f, points_text_index);
-    text_manager->drawText(points_text_index);
+    draw_text(points_text_index);
 };
 
 int check_collisions(Lazarus::MeshManager::Mesh a, Lazarus::MeshManager::Mesh b)
@@ -369,7 +997,7 @@ int check_collisions(Lazarus::MeshManager::Mesh a, Lazarus::MeshManager::Mesh b)
 
 void game_end()
 {
-    window->close();
+    if(window) window->close();
 };
 
 void move_spaceship()
@@ -392,7 +1020,7 @@ void move_spaceship()
         // transformer.translateCameraAsset(camera, -0.01, 0.0, 0.0, 0.01);
         transformer.translateMeshAsset(spaceship.mesh, 0.0, 0.0, 0.1);
         transformer.rotateMeshAsset(spaceship.mesh, 0.2, 0.0, 0.0);
-        window->snapCursor(center_x, center_y);
+        if(window) window->snapCursor(center_x, center_y);
 
         spaceship.x_rotation += 0.2;
     }
@@ -403,7 +1031,7 @@ void move_spaceship()
         // transformer.translateCameraAsset(camera, 0.01, 0.0, 0.0, 0.01);
         transformer.translateMeshAsset(spaceship.mesh, 0.0, 0.0, -0.1);
         transformer.rotateMeshAsset(spaceship.mesh, -0.2, 0.0, 0.0);
-        window->snapCursor(center_x, center_y);
+        if(window) window->snapCursor(center_x, center_y);
 
         spaceship.x_rotation -= 0.2;
     };
@@ -414,7 +1042,7 @@ void move_spaceship()
         transformer.translateLightAsset(point_light, 0.0, -0.2, 0.0);
         // transformer.translateCameraAsset(camera, 0.0, 0.01, 0.0, 0.01);
         transformer.translateMeshAsset(spaceship.mesh, 0.0, -0.1, 0.0);
-        window->snapCursor(center_x, center_y);
+        if(window) window->snapCursor(center_x, center_y);
     }
     //  Move down
     else if(mouse_y < (center_y) - mouse_sensitivity)
@@ -422,7 +1050,7 @@ void move_spaceship()
         transformer.translateLightAsset(point_light, 0.0, 0.2, 0.0);
         // transformer.translateCameraAsset(camera, 0.0, -0.01, 0.0, 0.01);
         transformer.translateMeshAsset(spaceship.mesh, 0.0, 0.1, 0.0);
-        window->snapCursor(center_x, center_y);
+        if(window) window->snapCursor(center_x, center_y);
     };
 
     //  Check for update to the ships rotation since last iteration
@@ -475,9 +1103,8 @@ void move_asteroids()
         {
             asteroids[i].has_colided = true;
 
-            //  Set crash1.mp3 back to begining and play
-            audio_manager->setPlaybackCursor(samples[0], 1);
-            audio_manager->playAudio(samples[0]);
+            //  Play crash1.mp3, bigger hits take priority over smaller ones
+            queue_audio(audio_command_play, sample_crash, asteroids[i].damage_modifier);
 
             //  Bounce asteroid off ship
             int8_t offset_a = 0;
@@ -576,7 +1203,7 @@ void move_rockets()
             transformer.translateMeshAsset(missiles[i].mesh, -10.0, missiles[i].y_spawn_offset, missiles[i].z_spawn_offset);
 
             //  Play rocket sample
-            audio_manager->playAudio(samples[2]);
+            queue_audio(audio_command_play, sample_missile_travel, 0, i);
         };
 
         //  Advance traveling missiles
@@ -610,9 +1237,7 @@ void move_rockets()
                     fracture_asteroid(asteroids[j]);
 
                     //  stop playing missile_travel.mp3, start playing missile_impact.mp3
-                    audio_manager->pauseAudio(samples[2]);
-                    audio_manager->setPlaybackCursor(samples[3], 1);
-                    audio_manager->playAudio(samples[3]);
+                    queue_audio(audio_command_impact, sample_missile_impact, asteroids[j].points_worth, i);
                 };
             };
         }
@@ -625,16 +1250,8 @@ void move_rockets()
             missiles[i].explosion.brightness = 0.0;
             transformer.translateMeshAsset(missiles[i].mesh, 100.0f, -missiles[i].y_spawn_offset, -missiles[i].z_spawn_offset);
 
-            //  Pause the audio (if it hasn't been already upon coliding) and reset sound source location
-            if(!samples[2].isPaused)
-            {
-                audio_manager->pauseAudio(samples[2]);
-            }
-
-            if(!samples[3].isPaused)
-            {
-                audio_manager->pauseAudio(samples[3]);
-            }
+            //  Stop this missile's audio (if it hasn't been already upon coliding)
+            queue_audio(audio_command_stop_all, 0, 0, i);
         }
     };
 
@@ -648,17 +1265,16 @@ void menu()
     //  Spin spaceship
     camera_manager->loadCamera(camera);
     light_manager->loadLightSource(point_light);
-    mesh_manager->loadMesh(spaceship.mesh);
-    mesh_manager->drawMesh(spaceship.mesh);
+    draw_mesh(spaceship.mesh);
     
     menu_rotation += 0.3;
     transformer.rotateMeshAsset(spaceship.mesh, 0.0, 0.3, 0.0);
 
     //  Draw title menu
     text_manager->loadText("SATURNS RAGE", (globals.getDisplayWidth() / 2) - 260, 1000, 10, 1.0, 0.0, 0.0, title_text_index);
-    text_manager->drawText(title_text_index);
+    draw_text(title_text_index);
     text_manager->loadText("PRESS [ENTER] TO BEGIN", (globals.getDisplayWidth() / 2) - 500, globals.getDisplayHeight() / 2, 10, 1.0, 1.0, 1.0, begin_text_index);
-    text_manager->drawText(begin_text_index);
+    draw_text(begin_text_index);
 
     //  End menu rendering
     if(event_manager.keyCode == 257) 
@@ -669,16 +1285,424 @@ void menu()
 
 };
 
-int main()
+void govern_quality(_Float32 frame_ms)
+{
+    //  Moving average over the last second or so of frames
+    const uint32_t window_size = sizeof(governor.samples) / sizeof(_Float32);
+    governor.samples[governor.frame % window_size] = frame_ms;
+    governor.sample_count = std::min(governor.sample_count + 1, window_size);
+    governor.frame += 1;
+
+    _Float32 total = 0.0;
+    for(uint32_t i = 0; i < governor.sample_count; i++) total += governor.samples[i];
+    governor.average_ms = total / governor.sample_count;
+
+    //  Give the average time to reflect the last change before acting again
+    if(!governor.enabled || governor.sample_count < window_size) return;
+    if(governor.cooldown > 0)
+    {
+        governor.cooldown -= 1;
+        return;
+    };
+
+    uint8_t level = governor.level;
+    if(governor.average_ms > governor.target_ms * quality_downgrade_ratio && level > 0) level -= 1;
+    else if(governor.average_ms < governor.target_ms * quality_upgrade_ratio && level < quality_level_count - 1) level += 1;
+
+    if(level != governor.level)
+    {
+        //  frame,from,to,average_ms,target_ms
+        char line[128] = {};
+        std::snprintf(line, sizeof(line), "quality,%u,%s,%s,%.3f,%.3f\n", governor.frame, quality_levels[governor.level].name, quality_levels[level].name, governor.average_ms, governor.target_ms);
+        *governor.log << line << std::flush;
+
+        governor.level = level;
+        governor.cooldown = quality_cooldown_frames;
+    };
+};
+
+void update_game()
+{
+    move_spaceship();
+    move_asteroids();
+    move_powerup(ammo_bonus);
+    move_powerup(health_bonus);
+    move_background();
+    move_rockets();
+};
+
+bool load_session()
 {
+    //  Replays are plain text, one "keycode mouse_offset_x mouse_offset_y" line per frame
+    //  Note: Offsets rather than absolute positions, so a session recorded at one resolution replays at any other
+    if(!session.replay_path.empty())
+    {
+        std::ifstream file(session.replay_path);
+        SessionFrame frame = {};
+        while(file >> frame.key_code >> frame.mouse_offset_x >> frame.mouse_offset_y) session.frames.push_back(frame);
+
+        if(!file.is_open() || session.frames.empty())
+        {
+            std::fprintf(stderr, "Unable to read a session from: %s\n", session.replay_path.c_str());
+            return false;
+        };
+    };
+
+    if(!session.record_path.empty())
+    {
+        session.recording.open(session.record_path);
+        if(!session.recording.is_open())
+        {
+            std::fprintf(stderr, "Unable to open recording: %s\n", session.record_path.c_str());
+            return false;
+        };
+    };
+
+    return true;
+};
+
+void record_session_frame()
+{
+    if(session.recording.is_open())
+    {
+        session.recording
+        << event_manager.keyCode << ' '
+        << (event_manager.mouseX - static_cast<int32_t>(globals.getDisplayWidth() / 2)) << ' '
+        << (event_manager.mouseY - static_cast<int32_t>(globals.getDisplayHeight() / 2)) << '\n';
+    };
+};
+
+void replay_session_frame(uint32_t frame)
+{
+    int32_t center_x = globals.getDisplayWidth() / 2;
+    int32_t center_y = globals.getDisplayHeight() / 2;
+
+    //  Past the end of the recording, hold the mouse centered so the ship flies straight
+    if(frame < session.frames.size())
+    {
+        event_manager.keyCode = session.frames[frame].key_code;
+        event_manager.mouseX  = center_x + session.frames[frame].mouse_offset_x;
+        event_manager.mouseY  = center_y + session.frames[frame].mouse_offset_y;
+    }
+    else
+    {
+        event_manager.keyCode = 0;
+        event_manager.mouseX  = center_x;
+        event_manager.mouseY  = center_y;
+    };
+};
+
+#ifdef SATURN_HEADLESS
+_Float64 percentile(std::vector<_Float64> values, _Float64 fraction)
+{
+    if(values.empty()) return 0.0;
+
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>(fraction * (values.size() - 1))];
+};
+
+void report_stats(const std::vector<FrameStats> &stats)
+{
+    std::vector<_Float64> cpu = {};
+    std::vector<_Float64> gpu = {};
+    _Float64 draws = 0.0;
+    _Float64 triangles = 0.0;
+
+    for(uint32_t i = 0; i < stats.size(); i++)
+    {
+        cpu.push_back(stats[i].cpu_submit_ms);
+        gpu.push_back(stats[i].gpu_ms);
+        draws += stats[i].draw_calls;
+        triangles += stats[i].triangles;
+    };
+
+    _Float64 frames = std::max<_Float64>(1.0, stats.size());
+    std::printf("frames:        %zu\n", stats.size());
+    std::printf("cpu submit ms: p50 %.3f  p95 %.3f  max %.3f\n", percentile(cpu, 0.5), percentile(cpu, 0.95), percentile(cpu, 1.0));
+    std::printf("gpu ms:        p50 %.3f  p95 %.3f  max %.3f\n", percentile(gpu, 0.5), percentile(gpu, 0.95), percentile(gpu, 1.0));
+    std::printf("draws/frame:   %.1f\n", draws / frames);
+    std::printf("tris/frame:    %.1f\n", triangles / frames);
+
+    if(!headless.stats_path.empty())
+    {
+        std::ofstream file(headless.stats_path);
+        file << "frame,cpu_submit_ms,gpu_ms,draw_calls,triangles,quality\n";
+        for(uint32_t i = 0; i < stats.size(); i++)
+        {
+            file << i << ',' << stats[i].cpu_submit_ms << ',' << stats[i].gpu_ms << ',' << stats[i].draw_calls << ',' << stats[i].triangles << ',' << quality_levels[stats[i].quality].name << '\n';
+        };
+    };
+};
+
+int run_headless()
+{
+    std::vector<FrameStats> stats = {};
+    uint32_t golden_captured = 0;
+
+    //  Without a recording there is nobody to press [ENTER], start straight into the game
+    if(session.frames.empty()) player_ready = true;
+
+    for(uint32_t frame = 0; frame < headless.frames; frame++)
+    {
+        std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+        replay_session_frame(frame);
+
+        //  Reuse the oldest query pair once its results are due
+        if(frame >= query_latency) read_frame_queries(frame - query_latency, stats[frame - query_latency].gpu_ms, stats[frame - query_latency].triangles);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, offscreen_fbo);
+        glViewport(0, 0, headless.width, headless.height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw_call_count = 0;
+
+        bool ready = player_ready;
+        begin_frame_queries(frame);
+        std::chrono::steady_clock::time_point submit_start = std::chrono::steady_clock::now();
+
+        if(ready)
+        {
+            load_environment();
+            draw_assets();
+        }
+        else
+        {
+            menu();
+        };
+
+        std::chrono::steady_clock::time_point submit_end = std::chrono::steady_clock::now();
+        end_frame_queries();
+
+        FrameStats frame_stats = {};
+        frame_stats.cpu_submit_ms   = std::chrono::duration<_Float64, std::milli>(submit_end - submit_start).count();
+        frame_stats.draw_calls      = draw_call_count;
+        frame_stats.quality         = governor.level;
+        stats.push_back(frame_stats);
+
+        if(ready) update_game();
+
+        glFlush();
+        _Float32 frame_ms = std::chrono::duration<_Float32, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+
+        //  Note: Captured after timing so that the readback doesn't count against the frame
+        if(std::find(headless.golden_frames.begin(), headless.golden_frames.end(), frame) != headless.golden_frames.end())
+        {
+            capture_golden(frame);
+            golden_captured += 1;
+        };
+
+        //  GPU time lags by the query latency, but is what catches fill and shading load
+        _Float32 gpu_ms = frame >= query_latency ? stats[frame - query_latency].gpu_ms : 0.0;
+        govern_quality(std::max(frame_ms, gpu_ms));
+
+        if
+        (
+            globals.getExecutionState() != LAZARUS_OK   ||
+            event_manager.keyCode == 88                 ||
+            game_over
+        )
+        {
+            break;
+        };
+    };
+
+    //  Drain whatever is still in flight
+    uint32_t first_pending = stats.size() > query_latency ? stats.size() - query_latency : 0;
+    for(uint32_t i = first_pending; i < stats.size(); i++) read_frame_queries(i, stats[i].gpu_ms, stats[i].triangles);
+
+    report_stats(stats);
+    delete_frame_queries();
+    headless_destroy_context();
+
+    //  The game can end (or the replay can press [X]) before the requested frame count is reached
+    if(stats.size() < headless.frames)
+    {
+        std::fprintf(stderr, "Headless: run ended at frame %zu of %u, stats cover only the frames rendered\n", stats.size(), headless.frames);
+    };
+
+    if(golden_captured < headless.golden_frames.size())
+    {
+        std::fprintf(stderr, "Headless: only %u of %zu golden frames were captured\n", golden_captured, headless.golden_frames.size());
+        return 1;
+    };
+
+    return globals.getExecutionState() == LAZARUS_OK ? 0 : 1;
+};
+#endif
+
+uint32_t parse_count(const std::string &value, uint32_t minimum)
+{
+    //  std::stoul accepts "-1" (wrapping around) and stops quietly at trailing junk, so check the whole string was a number
+    size_t consumed = 0;
+    unsigned long count = (value.empty() || value[0] == '-') ? 0 : std::stoul(value, &consumed);
+
+    if(consumed == 0 || consumed != value.size() || count < minimum || count > UINT32_MAX) throw std::invalid_argument(value);
+
+    return static_cast<uint32_t>(count);
+};
+
+_Float32 parse_milliseconds(const std::string &value)
+{
+    size_t consumed = 0;
+    _Float32 milliseconds = std::stof(value, &consumed);
+
+    if(consumed != value.size() || !(milliseconds > 0.0)) throw std::invalid_argument(value);
+
+    return milliseconds;
+};
+
+bool parse_args(int argc, char **argv)
+{
+    //  Last option seen that only means something to a headless run
+    std::string headless_option = "";
+
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = (i + 1) < argc;
+
+        if(arg == "--frames" || arg == "--width" || arg == "--height" || arg == "--golden" || arg == "--golden-dir" || arg == "--stats" || arg == "--replay")
+        {
+            headless_option = arg;
+        };
+
+        //  Note: Malformed numbers throw from parse_count() / parse_milliseconds() and are reported the same as any other bad argument
+        try
+        {
+            if(arg == "--headless")                     headless.enabled = true;
+            else if(arg == "--frames" && has_value)     headless.frames = parse_count(argv[++i], 1);
+            else if(arg == "--width" && has_value)      headless.width = parse_count(argv[++i], 1);
+            else if(arg == "--height" && has_value)     headless.height = parse_count(argv[++i], 1);
+            else if(arg == "--golden-dir" && has_value) headless.golden_dir = argv[++i];
+            else if(arg == "--stats" && has_value)      headless.stats_path = argv[++i];
+            else if(arg == "--replay" && has_value)     session.replay_path = argv[++i];
+            else if(arg == "--record" && has_value)     session.record_path = argv[++i];
+            else if(arg == "--null-audio")              null_audio = true;
+            else if(arg == "--governor")                governor.requested = true;
+            else if(arg == "--target-ms" && has_value)  governor.target_ms = parse_milliseconds(argv[++i]);
+            else if(arg == "--quality" && has_value)
+            {
+                //  Pin a level by name, e.g. so benchmarks compare like with like
+                std::string name = argv[++i];
+                bool found = false;
+                for(uint8_t level = 0; level < quality_level_count; level++)
+                {
+                    if(name != quality_levels[level].name) continue;
+
+                    governor.level = level;
+                    found = true;
+                };
+                if(!found)
+                {
+                    std::fprintf(stderr, "Unknown quality level: %s\n", name.c_str());
+                    return false;
+                };
+                governor.pinned = true;
+            }
+            else if(arg == "--quality-log" && has_value)
+            {
+                governor.log_file.open(argv[++i]);
+                governor.log = &governor.log_file;
+                if(!governor.log_file.is_open())
+                {
+                    std::fprintf(stderr, "Unable to open quality log: %s\n", argv[i]);
+                    return false;
+                };
+            }
+            else if(arg == "--golden" && has_value)
+            {
+                //  Comma separated list of frame numbers
+                std::stringstream frames(argv[++i]);
+                std::string frame = "";
+                while(std::getline(frames, frame, ','))
+                {
+                    uint32_t number = parse_count(frame, 0);
+                    if(std::find(headless.golden_frames.begin(), headless.golden_frames.end(), number) == headless.golden_frames.end()) headless.golden_frames.push_back(number);
+                };
+            }
+            else
+            {
+                std::fprintf(stderr, "Unknown or incomplete argument: %s\n", arg.c_str());
+                return false;
+            };
+        }
+        catch(const std::exception &)
+        {
+            std::fprintf(stderr, "Unknown or incomplete argument: %s\n", arg.c_str());
+            return false;
+        };
+    };
+
+#ifndef SATURN_HEADLESS
+    if(headless.enabled)
+    {
+        std::fprintf(stderr, "--headless requires a build with -DSATURN_HEADLESS\n");
+        return false;
+    };
+#endif
+
+    //  Replays are only ever driven by the headless loop, and there is no input of its own to record
+    if(!headless.enabled && !headless_option.empty())
+    {
+        std::fprintf(stderr, "%s requires --headless\n", headless_option.c_str());
+        return false;
+    };
+
+    if(headless.enabled && !session.record_path.empty())
+    {
+        std::fprintf(stderr, "--record can't be used with --headless\n");
+        return false;
+    };
+
+    if(governor.pinned && governor.requested)
+    {
+        std::fprintf(stderr, "--quality and --governor can't be used together\n");
+        return false;
+    };
+
+    //  Quality levels change the simulation (fragment cap) and the rendered image, so anything that has to be
+    //  reproducible (benchmarks, recordings and their replays) holds one level unless --governor asks otherwise
+    bool reproducible = headless.enabled || !session.record_path.empty() || !session.replay_path.empty();
+    governor.enabled = !governor.pinned && (governor.requested || !reproducible);
+
+    return true;
+};
+
+int main(int argc, char **argv)
+{
+    if(!parse_args(argc, argv)) return 1;
+    if(!load_session()) return 1;
     init();
+
+#ifdef SATURN_HEADLESS
+    if(headless.enabled)
+    {
+        start_audio();
+        int status = run_headless();
+        stop_audio();
+
+        return status;
+    };
+#endif
+
     window->open();
 
-    audio_manager->playAudio(samples[1]);
+    start_audio();
+    queue_audio(audio_command_play, sample_music, 0xFF);
+
+    uint32_t frame = 0;
+    _Float64 gpu_ms = 0.0;
+    uint64_t triangles = 0;
 
     while(window->isOpen)
     {
+        //  The quality governor is fed the frame's CPU work or its GPU time, whichever is longer, not the time between frames
+        //  Note: The latter includes the vsync wait in handleBuffers() and so never drops below the refresh interval
+        std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+        if(frame >= query_latency) read_frame_queries(frame - query_latency, gpu_ms, triangles);
+
         event_manager.listen();
+        record_session_frame();
+        begin_frame_queries(frame);
 
         //  Game start
         if(player_ready)
@@ -688,18 +1712,16 @@ int main()
             draw_assets();
 
             //  Do game mechanics
-            move_spaceship();
-            move_asteroids();
-            move_powerup(ammo_bonus);
-            move_powerup(health_bonus);
-            move_background();
-            move_rockets();
+            update_game();
         }
         else
         {
             menu();
         };
 
+        end_frame_queries();
+        frame += 1;
+
         if
         (
             globals.getExecutionState() != LAZARUS_OK   || // If some error has surfaced from engine state
@@ -711,9 +1733,14 @@ int main()
         }
         else
         {
+            _Float32 cpu_ms = std::chrono::duration<_Float32, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+            govern_quality(std::max<_Float32>(cpu_ms, gpu_ms));
             window->handleBuffers();
         };
     };
 
+    stop_audio();
+    delete_frame_queries();
+
     return 0;
-};
\ No newline at end of file
+};
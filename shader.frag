@@ -106,8 +106,11 @@ void main ()
         vec3 illuminationResult = vec3(0.0, 0.0, 0.0);
 
         //  Calculate the fragment's diffuse lighting for each light in the scene.
+        //  Dark lights (e.g. idle explosions, or those over the quality budget) contribute nothing so skip them.
         for(int i = 0; i < lightCount; i++)
         {
+            if(lightBrightness[i] <= 0.0) continue;
+
             illuminationResult += (calculateLambertianDeflection(fragColor, lightPositions[i], lightColors[i]) * lightBrightness[i]);
         };
 